@@ -0,0 +1,87 @@
+#include "../../include/DLManagerAsync.h"
+#include <iostream>
+#include <functional>
+#include <future>
+#include <vector>
+
+#if __cpp_lib_coroutine >= 201902L
+/*
+A minimal coroutine type for the example. Real programs would use the task
+type of their own event loop or coroutine library.
+*/
+struct FireAndForget {
+	struct promise_type {
+		FireAndForget get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+FireAndForget loadWithCoroutine(std::string path, std::promise<void>& finished) {
+	try {
+		Polysoft::DLManager lib = co_await Polysoft::openAsync(path);
+		std::function<double(std::vector<int>)> average =
+			co_await Polysoft::getFunctionAsync<double(std::vector<int>)>(lib, "average");
+		std::cout << "Average from a coroutine: " << average({ 1, 2, 3, 4 }) << std::endl;
+	} catch (const Polysoft::DLException& e) {
+		std::cout << "Coroutine error: " << e.what() << std::endl;
+	}
+	finished.set_value();
+}
+#endif
+
+int main() {
+	std::string path = "./test" + Polysoft::DLManager::getSuffix();
+
+	std::cout << "Testing futures:" << std::endl;
+	Polysoft::DLManager lib = Polysoft::openAsync(path).get();
+	std::future<std::function<void()>> test = Polysoft::getFunctionAsync<void()>(lib, "test").toFuture();
+	test.get()();
+
+	std::cout << std::endl << "Testing callbacks:" << std::endl;
+	std::promise<void> opened;
+	Polysoft::openAsync("./does_not_exist" + Polysoft::DLManager::getSuffix(),
+		[&opened](Polysoft::DLManager) {
+			std::cout << "Unexpectedly opened a missing library" << std::endl;
+			opened.set_value();
+		},
+		[&opened](const Polysoft::DLException& e) {
+			std::cout << "Intentional error opening a missing library: " << e.what() << std::endl;
+			opened.set_value();
+		});
+	opened.get_future().wait();
+
+	std::promise<void> resolved;
+	Polysoft::getFunctionAsync<void()>(lib, "invalid_function_name",
+		[&resolved](std::function<void()>) {
+			resolved.set_value();
+		},
+		[&resolved](const Polysoft::DLException& e) {
+			std::cout << "Intentional error getting \"invalid_function_name\": " << e.what() << std::endl;
+			resolved.set_value();
+		});
+	resolved.get_future().wait();
+
+	std::cout << std::endl << "Testing a custom executor:" << std::endl;
+	std::vector<std::function<void()>> queue;
+	Polysoft::Executor enqueue = [&queue](std::function<void()> task) {
+		queue.push_back(std::move(task));
+	};
+	Polysoft::AsyncResult<Polysoft::DLManager> pending = Polysoft::openAsync(path, enqueue);
+	std::cout << "Ready before running the queue: " << pending.isReady() << std::endl;
+	for (std::function<void()>& task : queue) {
+		task();
+	}
+	std::cout << "Ready after running the queue: " << pending.isReady() << std::endl;
+
+#if __cpp_lib_coroutine >= 201902L
+	std::cout << std::endl << "Testing coroutines:" << std::endl;
+	std::promise<void> finished;
+	loadWithCoroutine(path, finished);
+	finished.get_future().wait();
+#else
+	std::cout << std::endl << "C++20 coroutines not supported." << std::endl;
+#endif
+}
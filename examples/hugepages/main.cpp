@@ -0,0 +1,122 @@
+#include "../../include/DLManager.h"
+#include <iostream>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+const size_t CALLS = 5000000;
+const int ROUNDS = 5;
+
+/*
+Counts iTLB misses of the calling thread with perf_event_open.
+Many containers and CI machines do not allow this, in which case only the
+call throughput is reported.
+*/
+class ItlbCounter {
+private:
+	int fd;
+public:
+	ItlbCounter() {
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HW_CACHE;
+		attr.config = PERF_COUNT_HW_CACHE_ITLB
+			| (PERF_COUNT_HW_CACHE_OP_READ << 8)
+			| (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+	}
+
+	~ItlbCounter() {
+		if (fd >= 0) {
+			close(fd);
+		}
+	}
+
+	bool available() const {
+		return fd >= 0;
+	}
+
+	void start() {
+		if (fd >= 0) {
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+
+	uint64_t stop() {
+		uint64_t count = 0;
+		if (fd >= 0) {
+			ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+				count = 0;
+			}
+		}
+		return count;
+	}
+};
+
+void measure(const char* label, Polysoft::Symbol<unsigned long(const unsigned*, size_t, unsigned long)>& run,
+	const std::vector<unsigned>& order, ItlbCounter& counter) {
+	unsigned long seed = 1;
+	double bestSeconds = 0;
+	uint64_t bestMisses = 0;
+
+	// Warm up, then keep the best round
+	seed = run(order.data(), order.size(), seed);
+	for (int round = 0; round < ROUNDS; ++round) {
+		counter.start();
+		auto start = std::chrono::steady_clock::now();
+		seed = run(order.data(), order.size(), seed);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		uint64_t misses = counter.stop();
+
+		if (round == 0 || elapsed.count() < bestSeconds) {
+			bestSeconds = elapsed.count();
+			bestMisses = misses;
+		}
+	}
+
+	std::cout << label << ": " << order.size() / bestSeconds / 1e6 << " M calls/s";
+	if (counter.available()) {
+		std::cout << ", " << bestMisses << " iTLB misses";
+	} else {
+		std::cout << ", iTLB misses unavailable (perf_event_open not permitted)";
+	}
+	std::cout << " (checksum " << seed << ")" << std::endl;
+}
+
+int main(int argc, char** argv) {
+	Polysoft::HugePageMode mode = Polysoft::HugePageMode::Transparent;
+	if (argc > 1 && std::strcmp(argv[1], "--explicit") == 0) {
+		mode = Polysoft::HugePageMode::Explicit;
+	}
+
+	Polysoft::DLManager lib("./plugin" + Polysoft::DLManager::getSuffix());
+	auto run = lib.getSymbol<unsigned long(const unsigned*, size_t, unsigned long)>("run");
+	size_t functions = lib.getFunction<size_t()>("function_count")();
+
+	std::vector<unsigned> order(CALLS);
+	std::mt19937 random(42);
+	std::uniform_int_distribution<unsigned> pick(0, static_cast<unsigned>(functions - 1));
+	for (unsigned& index : order) {
+		index = pick(random);
+	}
+
+	ItlbCounter counter;
+	measure("Regular pages", run, order, counter);
+
+	size_t remapped = lib.remapTextOnHugePages(mode);
+	std::cout << "Remapped " << remapped / 1024 << " kB of code for huge pages" << std::endl;
+
+	measure("Huge pages   ", run, order, counter);
+}
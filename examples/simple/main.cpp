@@ -45,6 +45,45 @@ int main() {
 
 	std::cout << "Average of randoms is: " << average(numbers) << std::endl;
 
+	std::cout << std::endl << "Testing a symbol outliving its manager:" << std::endl;
+	Polysoft::Symbol<void()> testSymbol;
+	{
+		Polysoft::DLManager scoped("./" + dyLibFileName);
+		testSymbol = scoped.getSymbol<void()>("test");
+		scoped.close();
+	}
+	testSymbol();
+
+#ifdef __linux__
+	std::cout << std::endl << "Testing library introspection:" << std::endl;
+	Polysoft::LibraryInfo info = lib2.getInfo();
+	std::cout << info.path << " loaded at 0x" << std::hex << info.baseAddress << std::dec
+		<< ", " << info.loadedSize << " bytes in PT_LOAD segments, "
+		<< info.tls.size << " bytes of TLS" << std::endl;
+	std::cout << info.dependencies.size() << " dependencies, "
+		<< info.getRelocationCount() << " relocations, opened in "
+		<< std::chrono::duration_cast<std::chrono::microseconds>(info.openDuration).count() << "us" << std::endl;
+	for (const Polysoft::DependencyInfo& dependency : info.dependencies) {
+		std::cout << "  " << std::string(dependency.depth * 2, ' ') << dependency.name << " => " << dependency.path << std::endl;
+	}
+
+	std::cout << std::endl << "Testing memory accounting:" << std::endl;
+	Polysoft::DLManager sampled;
+	sampled.open("./" + dyLibFileName, Polysoft::OpenOption::SampleHeap);
+	for (const Polysoft::MemoryUsage& usage : Polysoft::DLManager::getAllMemoryUsage()) {
+		std::cout << usage.path << ": " << usage.mappedSize / 1024 << " kB mapped, "
+			<< usage.rss / 1024 << " kB resident, " << usage.pss / 1024 << " kB proportional, "
+			<< usage.privateDirty / 1024 << " kB private dirty, "
+			<< usage.openHeapBytes << " bytes of heap growth during open" << std::endl;
+	}
+	std::cout << "Total resident: " << Polysoft::DLManager::getTotalMemoryUsage().rss / 1024 << " kB" << std::endl;
+#endif
+
+	std::cout << std::endl << "Testing CPU variant selection:" << std::endl;
+	Polysoft::DLManager variantLib;
+	std::cout << "Opened the " << variantLib.openVariant(".", "test") << " build of test" << std::endl;
+	variantLib.getFunction<void()>("test")();
+
 	std::cout << std::endl << "Testing fail cases:" << std::endl;
 	try {
 		lib2.getFunction<void()>("invalid_function_name");
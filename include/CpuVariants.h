@@ -0,0 +1,167 @@
+#ifndef __CPU_VARIANTS_H__
+#define __CPU_VARIANTS_H__
+
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define __DL_MANAGER_X86_CPUID__
+#include <intrin.h>
+#include <immintrin.h>
+#elif (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define __DL_MANAGER_X86_CPUID__
+#include <cpuid.h>
+#endif
+
+namespace Polysoft {
+    /**
+     * A build of a library that needs more than the baseline instruction set
+     */
+    struct CpuVariant {
+        /**
+         * The name of the variant, which is also its glibc-hwcaps subdirectory (e.g. "x86-64-v3")
+         */
+        std::string name;
+
+        /**
+         * What gets appended to the library name for the variant (e.g. "avx2" for "plugin_avx2.so")
+         */
+        std::string tag;
+    };
+
+    namespace detail {
+        /**
+         * Which x86-64 micro-architecture levels (as defined by the x86-64 psABI) the CPU supports
+         */
+        struct X86Features {
+            bool v2 = false;
+            bool v3 = false;
+            bool v4 = false;
+        };
+
+#ifdef __DL_MANAGER_X86_CPUID__
+        /**
+         * @return false if the CPU does not have the requested leaf
+         */
+        inline bool cpuid(unsigned leaf, unsigned regs[4]) {
+#ifdef _MSC_VER
+            int info[4];
+            __cpuid(info, static_cast<int>(leaf & 0x80000000u));
+            if(static_cast<unsigned>(info[0]) < leaf){
+                return false;
+            }
+            __cpuidex(info, static_cast<int>(leaf), 0);
+            for(int i = 0; i < 4; ++i){
+                regs[i] = static_cast<unsigned>(info[i]);
+            }
+#else
+            if(__get_cpuid_max(leaf & 0x80000000u, nullptr) < leaf){
+                return false;
+            }
+            __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+            return true;
+        }
+
+        inline unsigned long long xgetbv0() {
+#ifdef _MSC_VER
+            return _xgetbv(0);
+#else
+            unsigned lo, hi;
+            __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+            return (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+        }
+#endif
+
+        /**
+         * Checks every feature each level requires, so that a VM masking a single one of them
+         * does not get handed a build it cannot run
+         */
+        inline X86Features detectX86Features() {
+            X86Features features;
+#ifdef __DL_MANAGER_X86_CPUID__
+            unsigned leaf1[4] = { 0 }, leaf7[4] = { 0 }, extended1[4] = { 0 };
+            if(!cpuid(1, leaf1)){
+                return features;
+            }
+            cpuid(7, leaf7);
+            cpuid(0x80000001u, extended1);
+
+            unsigned ecx1 = leaf1[2], ebx7 = leaf7[1], ecxExt = extended1[2];
+            auto has = [](unsigned reg, int bit){ return (reg & (1u << bit)) != 0; };
+
+            //The OS has to save the AVX (and AVX-512) registers for them to be usable
+            unsigned long long xcr0 = has(ecx1, 27) ? xgetbv0() : 0;
+            bool avxState = (xcr0 & 0x6) == 0x6;
+            bool avx512State = (xcr0 & 0xe6) == 0xe6;
+
+            //CMPXCHG16B, LAHF-SAHF, POPCNT, SSE3, SSE4.1, SSE4.2, SSSE3
+            features.v2 = has(ecx1, 13) && has(ecxExt, 0) && has(ecx1, 23) && has(ecx1, 0)
+                && has(ecx1, 19) && has(ecx1, 20) && has(ecx1, 9);
+            //AVX, AVX2, BMI1, BMI2, F16C, FMA, LZCNT, MOVBE, OSXSAVE
+            features.v3 = features.v2 && avxState && has(ecx1, 28) && has(ebx7, 5) && has(ebx7, 3)
+                && has(ebx7, 8) && has(ecx1, 29) && has(ecx1, 12) && has(ecxExt, 5) && has(ecx1, 22);
+            //AVX512F, AVX512BW, AVX512CD, AVX512DQ, AVX512VL
+            features.v4 = features.v3 && avx512State && has(ebx7, 16) && has(ebx7, 30)
+                && has(ebx7, 28) && has(ebx7, 17) && has(ebx7, 31);
+#endif
+            return features;
+        }
+    };
+
+    /**
+     * @return The variants the current CPU can run, best first. The baseline build is not included.
+     *  Empty on architectures without known variants.
+     */
+    inline std::vector<CpuVariant> getSupportedCpuVariants() {
+        std::vector<CpuVariant> variants;
+        detail::X86Features features = detail::detectX86Features();
+
+        if(features.v4){
+            variants.push_back({ "x86-64-v4", "avx512" });
+        }
+        if(features.v3){
+            variants.push_back({ "x86-64-v3", "avx2" });
+        }
+        if(features.v2){
+            variants.push_back({ "x86-64-v2", "sse4_2" });
+        }
+        return variants;
+    }
+
+    /**
+     * A file that DLManager::openVariant() tries to open
+     */
+    struct VariantCandidate {
+        std::string path;
+        std::string variant;
+    };
+
+    /**
+     * Lists where the builds of a library that the current CPU can run may be, best first.
+     * Each variant is looked for in a glibc-hwcaps style subdirectory and then with its tag
+     * appended to the name. The baseline build always comes last.
+     *
+     * @param [in] directory The directory holding the builds, the current directory if empty
+     * @param [in] name The library name without suffix (e.g. "plugin")
+     * @param [in] suffix The platform's library suffix (e.g. ".so")
+     * @return The candidates, with "baseline" as the variant of the last one
+     */
+    inline std::vector<VariantCandidate> getVariantCandidates(const std::string& directory,
+        const std::string& name, const std::string& suffix)
+    {
+        //Always use a path, a bare name would make the loader search the library path instead
+        std::string base = directory.empty() ? "./" : directory + "/";
+        std::vector<VariantCandidate> candidates;
+
+        for(const CpuVariant& variant : getSupportedCpuVariants()){
+            candidates.push_back({ base + "glibc-hwcaps/" + variant.name + "/" + name + suffix, variant.name });
+            candidates.push_back({ base + name + "_" + variant.tag + suffix, variant.name });
+        }
+        candidates.push_back({ base + name + suffix, "baseline" });
+        return candidates;
+    }
+};
+
+#endif
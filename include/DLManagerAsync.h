@@ -0,0 +1,324 @@
+#ifndef __DL_MANAGER_ASYNC_H__
+#define __DL_MANAGER_ASYNC_H__
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+//Check for C++20 coroutine support
+#if __cpp_impl_coroutine >= 201902L
+#include <coroutine>
+#endif
+
+#include "DLManager.h"
+
+namespace Polysoft {
+    /**
+     * Runs a task somewhere, for example on an event loop or a thread pool.
+     * The task must eventually be run exactly once.
+     */
+    typedef std::function<void(std::function<void()>)> Executor;
+
+    /**
+     * @return An Executor that runs every task on a new detached thread
+     */
+    inline Executor getThreadExecutor() {
+        return [](std::function<void()> task){
+            std::thread(std::move(task)).detach();
+        };
+    }
+
+    namespace detail {
+        /**
+         * What an AsyncResult and the task producing its value share
+         */
+        template<typename T>
+        struct AsyncState {
+            std::mutex lock;
+            std::condition_variable done;
+            bool ready = false;
+            bool retrieved = false;
+            std::unique_ptr<T> value;
+            std::exception_ptr error;
+            std::function<void()> continuation;
+
+            /**
+             * Runs work and stores its result or exception, then wakes up whoever is waiting
+             */
+            void run(const std::function<T()>& work) {
+                try{
+                    value.reset(new T(work()));
+                } catch(...){
+                    error = std::current_exception();
+                }
+
+                std::function<void()> next;
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    ready = true;
+                    next = std::move(continuation);
+                }
+                done.notify_all();
+                if(next){
+                    next();
+                }
+            }
+
+            /**
+             * Marks the result as taken by its one consumer
+             *
+             * @throw std::future_error
+             *  If the result was already taken, or someone is already waiting to take it
+             */
+            void claim() {
+                std::lock_guard<std::mutex> guard(lock);
+                if(retrieved){
+                    throw std::future_error(std::future_errc::future_already_retrieved);
+                }
+                retrieved = true;
+            }
+
+            /**
+             * Has next run by whoever stores the result. Only the consumer that claim()'d the
+             * result sets one, so there is never an earlier continuation to lose.
+             *
+             * @return false if the result is already in, in which case next is not kept
+             */
+            bool setContinuation(std::function<void()>& next) {
+                std::lock_guard<std::mutex> guard(lock);
+                if(ready){
+                    return false;
+                }
+                continuation = std::move(next);
+                return true;
+            }
+        };
+    };
+
+    /**
+     * The result of an operation running on an Executor.
+     * It can be waited on like a std::future, handed completion callbacks with then(),
+     * or co_await'ed from a C++20 coroutine, which then resumes on the executor's thread.
+     * Like a std::future, the value can only be taken out once: after get(), then(), toFuture()
+     * or co_await, any further one of them throws std::future_error.
+     *
+     * @tparam T The type of the value produced
+     */
+    template<typename T>
+    class AsyncResult {
+    private:
+        std::shared_ptr<detail::AsyncState<T>> state;
+
+        /**
+         * Waits for the result and moves it out, the caller must have claim()'d it
+         */
+        T take() {
+            wait();
+            if(state->error){
+                std::rethrow_exception(state->error);
+            }
+            return std::move(*state->value);
+        }
+    public:
+        /**
+         * Starts work on the executor
+         *
+         * @param [in] work What to run, its exceptions are kept and rethrown by get()
+         * @param [in] executor Where to run it
+         */
+        AsyncResult(std::function<T()> work, const Executor& executor)
+            : state(std::make_shared<detail::AsyncState<T>>())
+        {
+            std::shared_ptr<detail::AsyncState<T>> shared = state;
+            executor([shared, work](){
+                shared->run(work);
+            });
+        }
+
+        /**
+         * @return true once the value or error is in
+         */
+        bool isReady() const {
+            std::lock_guard<std::mutex> guard(state->lock);
+            return state->ready;
+        }
+
+        /**
+         * Blocks until the value or error is in
+         */
+        void wait() const {
+            std::unique_lock<std::mutex> guard(state->lock);
+            state->done.wait(guard, [this](){ return state->ready; });
+        }
+
+        /**
+         * Blocks until the value is in and takes it
+         *
+         * @return The value produced
+         * @throw DLException
+         *  Whichever exception the operation threw, typically one from Exceptions.h
+         * @throw std::future_error
+         *  If the value was already taken
+         */
+        T get() {
+            state->claim();
+            return take();
+        }
+
+        /**
+         * Calls one of the callbacks once the operation finishes, on the thread that finished it
+         * (or right away on this thread if it already has). Exceptions that are not from
+         * Exceptions.h are passed on as a plain DLException with the same message.
+         * Exceptions thrown by onReady itself are not caught.
+         *
+         * @param [in] onReady Called with the value on success
+         * @param [in] onError Called with the error on failure
+         * @throw std::future_error
+         *  If the value was already taken
+         */
+        void then(std::function<void(T)> onReady, std::function<void(const DLException&)> onError) {
+            state->claim();
+            AsyncResult<T> self = *this;
+            std::function<void()> next = [self, onReady, onError]() mutable {
+                std::unique_ptr<T> value;
+                try{
+                    value.reset(new T(self.take()));
+                } catch(const DLException& e){
+                    onError(e);
+                    return;
+                } catch(const std::exception& e){
+                    onError(DLException(e.what()));
+                    return;
+                } catch(...){
+                    onError(DLException("Unknown error"));
+                    return;
+                }
+                onReady(std::move(*value));
+            };
+            if(!state->setContinuation(next)){
+                next();
+            }
+        }
+
+        /**
+         * @return A std::future that gets the value (or error) once the operation finishes
+         * @throw std::future_error
+         *  If the value was already taken
+         */
+        std::future<T> toFuture() {
+            state->claim();
+            std::shared_ptr<std::promise<T>> promise = std::make_shared<std::promise<T>>();
+            std::future<T> future = promise->get_future();
+
+            AsyncResult<T> self = *this;
+            std::function<void()> next = [self, promise]() mutable {
+                try{
+                    promise->set_value(self.take());
+                } catch(...){
+                    promise->set_exception(std::current_exception());
+                }
+            };
+            if(!state->setContinuation(next)){
+                next();
+            }
+            return future;
+        }
+
+        //Check for C++20 coroutine support
+#if __cpp_lib_coroutine >= 201902L
+        bool await_ready() {
+            state->claim();
+            return isReady();
+        }
+
+        bool await_suspend(std::coroutine_handle<> waiting) {
+            std::function<void()> next = [waiting](){
+                waiting.resume();
+            };
+            //Carry on without suspending if the result came in since await_ready()
+            return state->setContinuation(next);
+        }
+
+        T await_resume() {
+            return take();
+        }
+#endif
+    };
+
+    /**
+     * Opens a dynamic library without blocking the calling thread
+     *
+     * @param [in] filename The dynamic library to be opened
+     * @param [in] executor Where to run the loader, a new thread by default
+     * @return The DLManager holding the library, once it is open
+     *
+     * The result throws OpenLibraryException when the library cannot be opened.
+     */
+    inline AsyncResult<DLManager> openAsync(const std::string& filename, const Executor& executor = getThreadExecutor()) {
+        return AsyncResult<DLManager>([filename](){
+            return DLManager(filename);
+        }, executor);
+    }
+
+    /**
+     * Opens a dynamic library without blocking the calling thread, calling back when done
+     *
+     * @param [in] filename The dynamic library to be opened
+     * @param [in] onReady Called with the DLManager holding the library once it is open
+     * @param [in] onError Called with the OpenLibraryException if it cannot be opened
+     * @param [in] executor Where to run the loader and the callbacks, a new thread by default
+     */
+    inline void openAsync(const std::string& filename, std::function<void(DLManager)> onReady,
+        std::function<void(const DLException&)> onError, const Executor& executor = getThreadExecutor())
+    {
+        openAsync(filename, executor).then(std::move(onReady), std::move(onError));
+    }
+
+    /**
+     * Gets a function without blocking the calling thread.
+     * The returned function keeps the library loaded, so lib may be closed in the meantime.
+     *
+     * @tparam T The signature of the function being retrieved (the same notation as std::function)
+     * @param [in] lib The library to get the function from
+     * @param [in] name The name of the function to be retrieved
+     * @param [in] executor Where to look the function up, a new thread by default
+     * @return The function, once it has been found
+     *
+     * The result throws NoSuchFunctionException or NoLibraryOpenException like getFunction().
+     */
+    template<typename T>
+    AsyncResult<std::function<T>> getFunctionAsync(const DLManager& lib, const std::string& name,
+        const Executor& executor = getThreadExecutor())
+    {
+        //The copy shares the open library, so it stays loaded until the lookup is done
+        DLManager copy = lib;
+        return AsyncResult<std::function<T>>([copy, name]() mutable {
+            return std::function<T>(copy.getSymbol<T>(name));
+        }, executor);
+    }
+
+    /**
+     * Gets a function without blocking the calling thread, calling back when done
+     *
+     * @tparam T The signature of the function being retrieved (the same notation as std::function)
+     * @param [in] lib The library to get the function from
+     * @param [in] name The name of the function to be retrieved
+     * @param [in] onReady Called with the function once it has been found
+     * @param [in] onError Called with the NoSuchFunctionException or NoLibraryOpenException
+     * @param [in] executor Where to look the function up and run the callbacks, a new thread by default
+     */
+    template<typename T>
+    void getFunctionAsync(const DLManager& lib, const std::string& name, std::function<void(std::function<T>)> onReady,
+        std::function<void(const DLException&)> onError, const Executor& executor = getThreadExecutor())
+    {
+        getFunctionAsync<T>(lib, name, executor).then(std::move(onReady), std::move(onError));
+    }
+};
+
+#endif
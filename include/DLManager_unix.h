@@ -3,6 +3,9 @@
 
 #include <string>
 #include <functional>
+#include <chrono>
+#include <fstream>
+#include <vector>
 #include <dlfcn.h>
 
 //Check for C++17 support
@@ -11,8 +14,11 @@
 #endif
 
 #include "Exceptions.h"
-
-typedef void* SharedLib;
+#include "LibraryRef.h"
+#include "LibraryInfo.h"
+#include "LibraryMemory.h"
+#include "HugePages.h"
+#include "CpuVariants.h"
 
 namespace Polysoft{
     /**
@@ -22,20 +28,25 @@ namespace Polysoft{
     private:
         /**
          *  This is used for storing the handle for whichever library is being used to actually load
-         *  the dynamic library.
+         *  the dynamic library. It is shared with copies of this DLManager and with every Symbol
+         *  retrieved from it, the library is only closed once all of them are gone.
          */
-        SharedLib handle = nullptr;
+        LibraryRef library;
 
         /**
-         * This is used primarily for copying DLManager around, since the handle will not close
-         * unless dlclose has been called as many times as dlopen has been called
+         * The path the library was opened from
          */
         std::string dest;
+
+        /**
+         * The CPU variant openVariant() picked, empty when opened directly
+         */
+        std::string variant;
     public:
         /**
          * Default constructor, does not open any dynamic library 
          */
-        DLManager() : handle(nullptr){}
+        DLManager(){}
 
         /**
          * Constructor that opens the provided dynamic library
@@ -46,7 +57,6 @@ namespace Polysoft{
          *  When the library cannot be opened, an OpenLibraryException is thrown
          */
         DLManager(const std::string& filename)
-			: handle(nullptr)
 		{
             open(filename);
         }
@@ -62,16 +72,12 @@ namespace Polysoft{
         }
 
         /**
-         * Copy Constructor, makes a copy of whatever was passed without destroying it
+         * Copy Constructor, makes a copy of whatever was passed without destroying it.
+         * The copy shares the already open library instead of opening it again.
          * 
          * @param [in] in The DLManager object to be copied
-         * 
-         * @throw OpenLibraryException 
-         *  When the library cannot be opened, an OpenLibraryException is thrown         
          */
-        DLManager(const DLManager &in) : handle(nullptr){
-            open(in.dest);
-        }
+        DLManager(const DLManager &in) : library(in.library), dest(in.dest), variant(in.variant){}
 
         //Check for C++17 support
 #if __cpp_lib_filesystem >= 201703L
@@ -85,7 +91,6 @@ namespace Polysoft{
          *  When the library cannot be opened, an OpenLibraryException is thrown
          */
         DLManager(const std::filesystem::path& filepath)
-            : handle(nullptr)
         {
             open(filepath);
         }
@@ -98,25 +103,18 @@ namespace Polysoft{
          * 
          * @param [in] in The DLManager object to be copied 
          */
-        DLManager(DLManager &&in) {
-            handle = in.handle;
-            dest = in.dest;
-
-            in.handle = nullptr;
-        }
+        DLManager(DLManager &&in) : library(std::move(in.library)), dest(std::move(in.dest)), variant(std::move(in.variant)){}
 
         /**
          * Normal assignment operator, you should know how this works
          * 
          * @param [in] in The DLManager object that will be assigned to the current class instance
-         * 
-         * @throw OpenLibraryException 
-         *  When the library cannot be opened, an OpenLibraryException is thrown
          */
 
         DLManager& operator=(const DLManager& in){
+            library = in.library;
             dest = in.dest;
-            open(dest);
+            variant = in.variant;
             
             return *this;
         }
@@ -130,10 +128,10 @@ namespace Polysoft{
          * @param [in] in The DLManager object to be assigned to the current class instance 
          */
         DLManager& operator=(DLManager&& in){
-            handle = in.handle;
-            dest = in.dest;
+            library = std::move(in.library);
+            dest = std::move(in.dest);
+            variant = std::move(in.variant);
 
-            in.handle = nullptr;
             return *this;
         }
 
@@ -163,39 +161,98 @@ namespace Polysoft{
          *  When the library cannot be opened, an OpenLibraryException is thrown
          */
         void open(const std::string& filename){
-            if(handle != nullptr){
+            open(filename, OpenOption::Default);
+        }
+
+        /**
+         * Opens the supplied dynamic library, doing extra work while at it
+         * 
+         * @param [in] filename
+         *  The dynamic library to be opened
+         * @param [in] option
+         *  What else to do, OpenOption::SampleHeap records the heap growth (Linux only)
+         * @throw OpenLibraryException
+         *  When the library cannot be opened, an OpenLibraryException is thrown
+         */
+        void open(const std::string& filename, OpenOption option){
+            if(library){
                 close();
             }
             //Clear previous errors
             dlerror();
-            handle = dlopen(filename.c_str(), RTLD_LAZY);
+            LoadStats stats;
+#ifdef __linux__
+            bool sampleHeap = option == OpenOption::SampleHeap;
+            long long heapBefore = sampleHeap ? detail::getHeapInUse() : 0;
+#else
+            (void)option;
+#endif
+            auto start = std::chrono::steady_clock::now();
+            SharedLib handle = dlopen(filename.c_str(), RTLD_LAZY);
+            stats.openDuration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+#ifdef __linux__
+            if(sampleHeap){
+                stats.openHeapBytes = detail::getHeapInUse() - heapBefore;
+            }
+#endif
 
             if(handle == nullptr){
                 throw OpenLibraryException(dlerror());
             }
+            library = LibraryRef(handle, stats);
             dest = filename;
+            variant.clear();
         }
 
         /**
-         * Closes the previously open()'d dynamic library
+         * Opens the best build of a library that the current CPU can run, see
+         * getVariantCandidates() for where builds are looked for. Variants that are missing or
+         * fail to open are skipped, ending with the baseline build directory/name+getSuffix().
          * 
-         * @throw CloseLibraryException
-         *  When the library cannot be closed, a CloseLibraryException is thrown 
+         * @param [in] directory The directory holding the builds, the current directory if empty
+         * @param [in] name The library name without suffix (e.g. "plugin")
+         * @return The variant that was opened (e.g. "x86-64-v3"), "baseline" if none was
+         * @throw OpenLibraryException
+         *  When not even the baseline build can be opened, an OpenLibraryException is thrown
          */
-        void close(){
-            if(handle == nullptr){
-                return;
+        std::string openVariant(const std::string& directory, const std::string& name){
+            std::vector<VariantCandidate> candidates = getVariantCandidates(directory, name, getSuffix());
+
+            for(size_t i = 0; i + 1 < candidates.size(); ++i){
+                if(!std::ifstream(candidates[i].path).good()){
+                    continue;
+                }
+                try{
+                    open(candidates[i].path);
+                    variant = candidates[i].variant;
+                    return variant;
+                } catch(const OpenLibraryException&){
+                    //Fall through to the next best build
+                }
             }
 
-            //Clear previous errors
-            dlerror();
-            int err = dlclose(handle);
+            open(candidates.back().path);
+            variant = candidates.back().variant;
+            return variant;
+        }
 
-            if(err != 0){
-                throw CloseLibraryException(dlerror());
-            }
-            //Clear the dangling pointer
-            handle = nullptr;
+        /**
+         * @return The variant picked by openVariant(), empty if the library was opened with open()
+         */
+        const std::string& getVariant() const {
+            return variant;
+        }
+
+        /**
+         * Closes the previously open()'d dynamic library.
+         * If copies of this DLManager or Symbols retrieved from it are still alive, the library
+         * stays loaded until the last of them is destroyed.
+         * 
+         * @throw CloseLibraryException
+         *  When the library cannot be closed, a CloseLibraryException is thrown 
+         */
+        void close(){
+            library.reset();
         }
         
         /**
@@ -229,13 +286,13 @@ namespace Polysoft{
          */
         template<typename T>
         void getFunction(const char *name, std::function<T> &func_dest){
-            if(this->handle == nullptr){
+            if(!this->library){
                 throw NoLibraryOpenException("You need to call open() before calling getFunction()!");
             }
 
             //Clear previous errors
             dlerror();
-            func_dest = reinterpret_cast<T*>(dlsym(this->handle, name));
+            func_dest = reinterpret_cast<T*>(dlsym(this->library.get(), name));
 
             if(func_dest == nullptr){
                 throw NoSuchFunctionException(dlerror());
@@ -275,12 +332,12 @@ namespace Polysoft{
          */
         template<typename T>
         std::function<T> getFunction(const char *name){
-            if(this->handle == nullptr){
+            if(!this->library){
                 throw NoLibraryOpenException("You need to call open() before calling getFunction()!");
             }
             std::function<T> result;
             //Clear previous errors
-            result = reinterpret_cast<T*>(dlsym(this->handle, name));
+            result = reinterpret_cast<T*>(dlsym(this->library.get(), name));
 
             if(result == nullptr){
                 throw NoSuchFunctionException(dlerror());
@@ -289,6 +346,207 @@ namespace Polysoft{
             return result;
         }
 
+        /**
+         * Gets a function as a Symbol, which keeps the library loaded for as long as it exists
+         * 
+         * @tparam T The signature of the function being retrieved (the same notation as std::function)
+         * @param [in] name The name of the function to be retrieved
+         * 
+         * @return A Symbol referring to the function
+         * 
+         * @throw NoSuchFunctionException
+         *  If a function cannot be found, then a NoSuchFunctionException is thrown
+         * @throw NoLibraryOpenException
+         *  If a dynamic library is not opened beforehand, a NoLibraryOpenException is thrown
+         */
+        template<typename T>
+        Symbol<T> getSymbol(const std::string &name){
+            return this->getSymbol<T>(name.c_str());
+        }
+
+        /**
+         * Gets a function as a Symbol, which keeps the library loaded for as long as it exists
+         * 
+         * @tparam T The signature of the function being retrieved (the same notation as std::function)
+         * @param [in] name The name of the function to be retrieved
+         * 
+         * @return A Symbol referring to the function
+         * 
+         * @throw NoSuchFunctionException
+         *  If a function cannot be found, then a NoSuchFunctionException is thrown
+         * @throw NoLibraryOpenException
+         *  If a dynamic library is not opened beforehand, a NoLibraryOpenException is thrown
+         */
+        template<typename T>
+        Symbol<T> getSymbol(const char *name){
+            if(!this->library){
+                throw NoLibraryOpenException("You need to call open() before calling getSymbol()!");
+            }
+
+            //Clear previous errors
+            dlerror();
+            T* func = reinterpret_cast<T*>(dlsym(this->library.get(), name));
+
+            if(func == nullptr){
+                throw NoSuchFunctionException(dlerror());
+            }
+
+            return Symbol<T>(this->library, func);
+        }
+
+        /**
+         * @return How long open() spent in dlopen, including the library's constructors
+         * 
+         * @throw NoLibraryOpenException
+         *  If a dynamic library is not opened beforehand, a NoLibraryOpenException is thrown
+         */
+        std::chrono::nanoseconds getOpenDuration() const {
+            if(!this->library){
+                throw NoLibraryOpenException("You need to call open() before calling getOpenDuration()!");
+            }
+            return library.getLoadStats().openDuration;
+        }
+
+#ifdef __linux__
+        /**
+         * Reports what the loader did to bring the open library in: where it was mapped, its
+         * segments, TLS usage, every library it pulled in and its dynamic relocations.
+         * (Linux only)
+         * 
+         * @return A report about the open library
+         * 
+         * @throw NoLibraryOpenException
+         *  If a dynamic library is not opened beforehand, a NoLibraryOpenException is thrown
+         * @throw LibraryInfoException
+         *  If the loader cannot report on the library, a LibraryInfoException is thrown
+         */
+        LibraryInfo getInfo() const {
+            if(!this->library){
+                throw NoLibraryOpenException("You need to call open() before calling getInfo()!");
+            }
+
+            LibraryInfo info;
+            detail::inspectLibrary(library.get(), info);
+            info.openDuration = library.getLoadStats().openDuration;
+
+            return info;
+        }
+
+        /**
+         * Reports how much memory the open library's own mappings use, from /proc/self/smaps.
+         * (Linux only)
+         * 
+         * @return The memory used by the open library
+         * 
+         * @throw NoLibraryOpenException
+         *  If a dynamic library is not opened beforehand, a NoLibraryOpenException is thrown
+         * @throw LibraryInfoException
+         *  If the library's mappings cannot be found or read, a LibraryInfoException is thrown
+         */
+        MemoryUsage getMemoryUsage() const {
+            if(!this->library){
+                throw NoLibraryOpenException("You need to call open() before calling getMemoryUsage()!");
+            }
+
+            std::vector<detail::MappedRange> ranges(1, detail::getMappedRange(library.get()));
+            std::vector<MemoryUsage> usage;
+            detail::readSmaps(ranges, usage);
+            usage[0].openHeapBytes = library.getLoadStats().openHeapBytes;
+
+            return usage[0];
+        }
+
+        /**
+         * Reports the memory used by every library currently open through any DLManager in the
+         * process, reading /proc/self/smaps only once. A library open()'d several times is
+         * reported once, with the heap growth of each open() added together.
+         * (Linux only)
+         * 
+         * @return One entry for each open library
+         * 
+         * @throw LibraryInfoException
+         *  If a library's mappings cannot be found or read, a LibraryInfoException is thrown
+         */
+        static std::vector<MemoryUsage> getAllMemoryUsage() {
+            std::vector<LibraryRef> libraries = LibraryRef::getOpenLibraries();
+
+            std::vector<SharedLib> handles;
+            std::vector<detail::MappedRange> ranges;
+            std::vector<long long> heap;
+            for(const LibraryRef& lib : libraries){
+                size_t i = 0;
+                while(i < handles.size() && handles[i] != lib.get()){
+                    ++i;
+                }
+                if(i == handles.size()){
+                    handles.push_back(lib.get());
+                    ranges.push_back(detail::getMappedRange(lib.get()));
+                    heap.push_back(0);
+                }
+                heap[i] += lib.getLoadStats().openHeapBytes;
+            }
+
+            std::vector<MemoryUsage> usage;
+            detail::readSmaps(ranges, usage);
+            for(size_t i = 0; i < usage.size(); ++i){
+                usage[i].openHeapBytes = heap[i];
+            }
+
+            return usage;
+        }
+
+        /**
+         * Adds up getAllMemoryUsage()
+         * (Linux only)
+         * 
+         * @return The memory used by all libraries currently open, with an empty path
+         * 
+         * @throw LibraryInfoException
+         *  If a library's mappings cannot be found or read, a LibraryInfoException is thrown
+         */
+        static MemoryUsage getTotalMemoryUsage() {
+            MemoryUsage total;
+            for(const MemoryUsage& usage : getAllMemoryUsage()){
+                total += usage;
+            }
+            return total;
+        }
+
+        /**
+         * Moves the open library's code onto huge pages to cut down on iTLB misses when calling
+         * into it. Only the part of each executable segment that covers whole huge pages (2 MiB on
+         * x86-64, as reported by /sys/kernel/mm/transparent_hugepage/hpage_pmd_size) can be moved,
+         * so link big libraries with -Wl,-z,max-page-size=0x200000 to get the most out of it.
+         * Execute-only segments are left alone. When huge pages are not available nothing is changed.
+         * (Linux only)
+         * 
+         * The moved code is no longer backed by the library file, so it is not shared with other
+         * processes and profilers may not be able to symbolize it.
+         * 
+         * @param [in] mode Which kind of huge pages to use
+         * @return How many bytes of code were remapped, 0 if none could be. With transparent huge
+         *  pages it is up to the kernel whether they are actually backed by huge pages.
+         * 
+         * @throw NoLibraryOpenException
+         *  If a dynamic library is not opened beforehand, a NoLibraryOpenException is thrown
+         * @throw LibraryInfoException
+         *  If the library's segments cannot be found, a LibraryInfoException is thrown
+         */
+        size_t remapTextOnHugePages(HugePageMode mode = HugePageMode::Transparent){
+            if(!this->library){
+                throw NoLibraryOpenException("You need to call open() before calling remapTextOnHugePages()!");
+            }
+            return detail::remapTextOnHugePages(library.get(), mode);
+        }
+#endif
+
+        /**
+         * @return A reference that keeps the currently open library loaded, empty if none is open
+         */
+        LibraryRef getLibrary() const {
+            return library;
+        }
+
 		/**
 		 * @return The standard file suffix of the shared dynamic library for the current platform.
 		 */
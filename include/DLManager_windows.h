@@ -3,6 +3,9 @@
 
 #include <string>
 #include <functional>
+#include <chrono>
+#include <fstream>
+#include <vector>
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
@@ -12,8 +15,8 @@
 #endif
 
 #include "Exceptions.h"
-
-typedef HMODULE SharedLib;
+#include "LibraryRef.h"
+#include "CpuVariants.h"
 
 namespace Polysoft {
 	/**
@@ -23,35 +26,29 @@ namespace Polysoft {
 	private:
 		/**
 		 *  This is used for storing the handle for whichever library is being used to actually load
-		 *  the dynamic library.
+		 *  the dynamic library. It is shared with copies of this DLManager and with every Symbol
+		 *  retrieved from it, the library is only closed once all of them are gone.
 		 */
-		SharedLib handle = nullptr;
+		LibraryRef library;
 
 		/**
-		 * This is used primarily for copying DLManager around, since the handle will not close
-		 * unless dlclose has been called as many times as dlopen has been called
+		 * The path the library was opened from
 		 */
 		std::string dest;
 
+		/**
+		 * The CPU variant openVariant() picked, empty when opened directly
+		 */
+		std::string variant;
+
 		std::string getLastErrMessage() {
-			DWORD dLastError = GetLastError();
-			LPCTSTR strErrorMessage = NULL;
-
-			FormatMessage(
-				FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS | FORMAT_MESSAGE_ARGUMENT_ARRAY | FORMAT_MESSAGE_ALLOCATE_BUFFER,
-				NULL,
-				dLastError,
-				0,
-				(LPSTR)&strErrorMessage,
-				0,
-				NULL);
-			return strErrorMessage;
+			return detail::getLastErrorMessage();
 		}
 	public:
 		/**
 		 * Default constructor, does not open any dynamic library
 		 */
-		DLManager() : handle(nullptr) {}
+		DLManager() {}
 
 		/**
 		 * Constructor that opens the provided dynamic library
@@ -62,7 +59,6 @@ namespace Polysoft {
 		 *  When the library cannot be opened, an OpenLibraryException is thrown
 		 */
 		DLManager(const std::string& filename)
-			: handle(nullptr)
 		{
 			open(filename);
 		}
@@ -79,7 +75,6 @@ namespace Polysoft {
 		 *  When the library cannot be opened, an OpenLibraryException is thrown
 		 */
 		DLManager(const std::filesystem::path& filepath)
-			: handle(nullptr)
 		{
 			open(filepath);
 		}
@@ -96,16 +91,12 @@ namespace Polysoft {
 		}
 
 		/**
-		 * Copy Constructor, makes a copy of whatever was passed without destroying it
+		 * Copy Constructor, makes a copy of whatever was passed without destroying it.
+		 * The copy shares the already open library instead of opening it again.
 		 *
 		 * @param [in] in The DLManager object to be copied
-		 *
-		 * @throw OpenLibraryException
-		 *  When the library cannot be opened, an OpenLibraryException is thrown
 		 */
-		DLManager(const DLManager& in) : handle(nullptr) {
-			open(in.dest);
-		}
+		DLManager(const DLManager& in) : library(in.library), dest(in.dest), variant(in.variant) {}
 
 		/**
 		 * Move schemantics copy constructor, makes a copy of whatever was pass, and trashing it for the sake of efficiency.
@@ -114,26 +105,18 @@ namespace Polysoft {
 		 *
 		 * @param [in] in The DLManager object to be copied
 		 */
-		DLManager(DLManager&& in) {
-			handle = in.handle;
-			dest = in.dest;
-
-			in.handle = nullptr;
-		}
+		DLManager(DLManager&& in) : library(std::move(in.library)), dest(std::move(in.dest)), variant(std::move(in.variant)) {}
 
 		/**
 		 * Normal assignment operator, you should know how this works
 		 *
 		 * @param [in] in The DLManager object that will be assigned to the current class instance
-		 *
-		 * @throw OpenLibraryException
-		 *  When the library cannot be opened, an OpenLibraryException is thrown
 		 */
 
 		DLManager& operator=(const DLManager& in) {
-			// TODO: Should this close the existing lib, in case there is one?
+			library = in.library;
 			dest = in.dest;
-			open(dest);
+			variant = in.variant;
 
 			return *this;
 		}
@@ -147,10 +130,10 @@ namespace Polysoft {
 		 * @param [in] in The DLManager object to be assigned to the current class instance
 		 */
 		DLManager& operator=(DLManager&& in) noexcept {
-			handle = in.handle;
-			dest = in.dest;
+			library = std::move(in.library);
+			dest = std::move(in.dest);
+			variant = std::move(in.variant);
 
-			in.handle = nullptr;
 			return *this;
 		}
 
@@ -180,33 +163,71 @@ namespace Polysoft {
 		 *  When the library cannot be opened, an OpenLibraryException is thrown
 		 */
 		void open(const std::string& filename) {
-			if (handle != nullptr) {
+			if (library) {
 				close();
 			}
-			handle = LoadLibrary(filename.c_str());
+			LoadStats stats;
+			auto start = std::chrono::steady_clock::now();
+			SharedLib handle = LoadLibrary(filename.c_str());
+			stats.openDuration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
 
 			if (handle == nullptr) {
 				throw OpenLibraryException(getLastErrMessage());
 			}
+			library = LibraryRef(handle, stats);
 			dest = filename;
+			variant.clear();
 		}
 
 		/**
-		 * Closes the previously open()'d dynamic library
+		 * Opens the best build of a library that the current CPU can run, see
+		 * getVariantCandidates() for where builds are looked for. Variants that are missing or
+		 * fail to open are skipped, ending with the baseline build directory/name+getSuffix().
+		 *
+		 * @param [in] directory The directory holding the builds, the current directory if empty
+		 * @param [in] name The library name without suffix (e.g. "plugin")
+		 * @return The variant that was opened (e.g. "x86-64-v3"), "baseline" if none was
+		 * @throw OpenLibraryException
+		 *  When not even the baseline build can be opened, an OpenLibraryException is thrown
+		 */
+		std::string openVariant(const std::string& directory, const std::string& name) {
+			std::vector<VariantCandidate> candidates = getVariantCandidates(directory, name, getSuffix());
+
+			for (size_t i = 0; i + 1 < candidates.size(); ++i) {
+				if (!std::ifstream(candidates[i].path).good()) {
+					continue;
+				}
+				try {
+					open(candidates[i].path);
+					variant = candidates[i].variant;
+					return variant;
+				} catch (const OpenLibraryException&) {
+					//Fall through to the next best build
+				}
+			}
+
+			open(candidates.back().path);
+			variant = candidates.back().variant;
+			return variant;
+		}
+
+		/**
+		 * @return The variant picked by openVariant(), empty if the library was opened with open()
+		 */
+		const std::string& getVariant() const {
+			return variant;
+		}
+
+		/**
+		 * Closes the previously open()'d dynamic library.
+		 * If copies of this DLManager or Symbols retrieved from it are still alive, the library
+		 * stays loaded until the last of them is destroyed.
 		 *
 		 * @throw CloseLibraryException
 		 *  When the library cannot be closed, a CloseLibraryException is thrown
 		 */
 		void close() {
-			if (handle == nullptr) {
-				return;
-			}
-
-			if(!FreeLibrary(handle)) {
-				throw CloseLibraryException(getLastErrMessage());
-			}
-			//Clear the dangling pointer
-			handle = nullptr;
+			library.reset();
 		}
 
 		/**
@@ -240,11 +261,11 @@ namespace Polysoft {
 		 */
 		template<typename T>
 		void getFunction(const char * name, std::function<T>& func_dest) {
-			if (handle == nullptr) {
+			if (!library) {
 				throw NoLibraryOpenException("You need to call open() before calling getFunction()!");
 			}
 
-			func_dest = reinterpret_cast<T>(GetProcAddress(handle, name););
+			func_dest = reinterpret_cast<T>(GetProcAddress(library.get(), name););
 
 			if (func_dest == nullptr) {
 				throw NoSuchFunctionException(getLastErrMessage());
@@ -284,11 +305,11 @@ namespace Polysoft {
 		 */
 		template<typename T>
 		std::function<T> getFunction(const char* name) {
-			if (handle == nullptr) {
+			if (!library) {
 				throw NoLibraryOpenException("You need to call open() before calling getFunction()!");
 			}
 
-			std::function<T> result = reinterpret_cast<T*>(GetProcAddress(handle, name));
+			std::function<T> result = reinterpret_cast<T*>(GetProcAddress(library.get(), name));
 
 			if (result == nullptr) {
 				throw NoSuchFunctionException(getLastErrMessage());
@@ -297,6 +318,72 @@ namespace Polysoft {
 			return result;
 		}
 
+		/**
+		 * Gets a function as a Symbol, which keeps the library loaded for as long as it exists
+		 *
+		 * @tparam T The signature of the function being retrieved (the same notation as std::function)
+		 * @param [in] name The name of the function to be retrieved
+		 *
+		 * @return A Symbol referring to the function
+		 *
+		 * @throw NoSuchFunctionException
+		 *  If a function cannot be found, then a NoSuchFunctionException is thrown
+		 * @throw NoLibraryOpenException
+		 *  If a dynamic library is not opened beforehand, a NoLibraryOpenException is thrown
+		 */
+		template<typename T>
+		Symbol<T> getSymbol(const std::string& name) {
+			return this->getSymbol<T>(name.c_str());
+		}
+
+		/**
+		 * Gets a function as a Symbol, which keeps the library loaded for as long as it exists
+		 *
+		 * @tparam T The signature of the function being retrieved (the same notation as std::function)
+		 * @param [in] name The name of the function to be retrieved
+		 *
+		 * @return A Symbol referring to the function
+		 *
+		 * @throw NoSuchFunctionException
+		 *  If a function cannot be found, then a NoSuchFunctionException is thrown
+		 * @throw NoLibraryOpenException
+		 *  If a dynamic library is not opened beforehand, a NoLibraryOpenException is thrown
+		 */
+		template<typename T>
+		Symbol<T> getSymbol(const char* name) {
+			if (!library) {
+				throw NoLibraryOpenException("You need to call open() before calling getSymbol()!");
+			}
+
+			T* func = reinterpret_cast<T*>(GetProcAddress(library.get(), name));
+
+			if (func == nullptr) {
+				throw NoSuchFunctionException(getLastErrMessage());
+			}
+
+			return Symbol<T>(library, func);
+		}
+
+		/**
+		 * @return How long open() spent in LoadLibrary, including the library's DllMain
+		 *
+		 * @throw NoLibraryOpenException
+		 *  If a dynamic library is not opened beforehand, a NoLibraryOpenException is thrown
+		 */
+		std::chrono::nanoseconds getOpenDuration() const {
+			if (!library) {
+				throw NoLibraryOpenException("You need to call open() before calling getOpenDuration()!");
+			}
+			return library.getLoadStats().openDuration;
+		}
+
+		/**
+		 * @return A reference that keeps the currently open library loaded, empty if none is open
+		 */
+		LibraryRef getLibrary() const {
+			return library;
+		}
+
 		/**
 		 * @return The standard file suffix of the shared dynamic library for the current platform.
 		 */
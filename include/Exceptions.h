@@ -62,6 +62,15 @@ namespace Polysoft {
         NoLibraryOpenException(const std::string& what_arg) : DLException(what_arg){}
         NoLibraryOpenException(const char *what_arg) : DLException(what_arg){}
     };
+
+    /**
+     * An exception for when the loader cannot report details about an open library
+     */
+    class LibraryInfoException : public DLException {
+    public:
+        LibraryInfoException(const std::string& what_arg) : DLException(what_arg){}
+        LibraryInfoException(const char *what_arg) : DLException(what_arg){}
+    };
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,201 @@
+#ifndef __HUGE_PAGES_H__
+#define __HUGE_PAGES_H__
+
+#include <cstddef>
+
+#ifdef __linux__
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "LibraryInfo.h"
+#endif
+
+namespace Polysoft {
+    /**
+     * Which kind of huge pages DLManager::remapTextOnHugePages() should use
+     */
+    enum class HugePageMode {
+        /**
+         * Transparent huge pages, requested with madvise(MADV_HUGEPAGE)
+         */
+        Transparent,
+
+        /**
+         * Pages from the hugetlbfs pool (vm.nr_hugepages), falling back to transparent huge pages
+         * when the pool is empty or the kernel cannot move them over the code
+         */
+        Explicit
+    };
+
+#ifdef __linux__
+    namespace detail {
+        /**
+         * @return The size of a PMD level huge page, which is what transparent huge pages use.
+         *  2 MiB if the kernel does not say, 0 if it reports a size that cannot be a huge page.
+         */
+        inline uintptr_t getHugePageSize() {
+            static const uintptr_t size = [](){
+                uintptr_t pmdSize = 2 * 1024 * 1024;
+                std::ifstream file("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size");
+                unsigned long long reported;
+                if(file >> reported){
+                    pmdSize = static_cast<uintptr_t>(reported);
+                }
+
+                uintptr_t pageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+                if(pmdSize <= pageSize || (pmdSize & (pmdSize - 1)) != 0){
+                    return uintptr_t(0);
+                }
+                return pmdSize;
+            }();
+            return size;
+        }
+
+        inline bool transparentHugePagesEnabled() {
+            std::ifstream enabled("/sys/kernel/mm/transparent_hugepage/enabled");
+            std::string setting;
+            if(!std::getline(enabled, setting)){
+                return false;
+            }
+            return setting.find("[never]") == std::string::npos;
+        }
+
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+        /**
+         * Makes an anonymous read/write mapping of size bytes from the hugetlbfs pool of
+         * getHugePageSize() pages
+         *
+         * @return The mapping, or nullptr if the pool cannot provide it
+         */
+        inline void* mapExplicitHugePages(size_t size) {
+            //Ask for pages of the size the code was aligned to rather than the pool's default
+            int shift = 0;
+            while((uintptr_t(1) << shift) < getHugePageSize()){
+                ++shift;
+            }
+            void* pages = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT), -1, 0);
+            return pages != MAP_FAILED ? pages : nullptr;
+        }
+#endif
+
+        /**
+         * Makes a huge page aligned anonymous read/write mapping of size bytes that the kernel may
+         * back with transparent huge pages
+         *
+         * @return The mapping, or nullptr if transparent huge pages are not available
+         */
+        inline void* mapTransparentHugePages(size_t size) {
+            if(!transparentHugePagesEnabled()){
+                return nullptr;
+            }
+
+            //Over-allocate so that a huge page aligned block fits, then trim the ends
+            const uintptr_t hugePageSize = getHugePageSize();
+            void* raw = mmap(nullptr, size + hugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if(raw == MAP_FAILED){
+                return nullptr;
+            }
+            uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+            uintptr_t aligned = (start + hugePageSize - 1) & ~(hugePageSize - 1);
+            uintptr_t tail = start + hugePageSize - aligned;
+            if(aligned != start){
+                munmap(raw, aligned - start);
+            }
+            if(tail != 0){
+                munmap(reinterpret_cast<void*>(aligned + size), tail);
+            }
+
+            void* pages = reinterpret_cast<void*>(aligned);
+            if(madvise(pages, size, MADV_HUGEPAGE) != 0){
+                munmap(pages, size);
+                return nullptr;
+            }
+            return pages;
+        }
+
+        /**
+         * Copies size bytes of code at start into pages and moves pages over it.
+         * pages is unmapped if the move fails, the code at start is left untouched.
+         *
+         * @return true if the code at start now lives in pages
+         */
+        inline bool moveCode(uintptr_t start, size_t size, void* pages) {
+            std::memcpy(pages, reinterpret_cast<const void*>(start), size);
+            if(mprotect(pages, size, PROT_READ | PROT_EXEC) != 0
+                || mremap(pages, size, size, MREMAP_MAYMOVE | MREMAP_FIXED, reinterpret_cast<void*>(start)) == MAP_FAILED){
+                munmap(pages, size);
+                return false;
+            }
+            return true;
+        }
+
+        /**
+         * Copies the huge page aligned part of every executable segment of a library into a
+         * mapping eligible for huge pages, then moves that mapping over the original with mremap.
+         * The move replaces the old pages in one step, so the code never disappears from under
+         * other threads. Execute-only segments are skipped since they cannot be copied, and so
+         * is any segment that does not span a whole huge page (on arm64 with 64 KiB pages, for
+         * example, huge pages are 512 MiB).
+         *
+         * @param [in] handle A handle returned by dlopen
+         * @param [in] mode The kind of huge pages to use
+         * @return How many bytes of code were remapped. With transparent huge pages it is up to
+         *  the kernel whether they are actually backed by huge pages.
+         * @throw LibraryInfoException
+         *  When the loader does not know about the handle, a LibraryInfoException is thrown
+         */
+        inline size_t remapTextOnHugePages(void* handle, HugePageMode mode) {
+            const link_map* map = getLinkMap(handle);
+
+            LibraryInfo info;
+            PhdrSearch search = { map, &info, false };
+            dl_iterate_phdr(collectSegments, &search);
+            if(!search.found){
+                throw LibraryInfoException(std::string("Could not find the program headers of ") + map->l_name);
+            }
+
+            const uintptr_t hugePageSize = getHugePageSize();
+            size_t remapped = 0;
+            if(hugePageSize == 0){
+                return remapped;
+            }
+            for(const SegmentInfo& segment : info.segments){
+                if(segment.type != PT_LOAD || (segment.flags & PF_X) == 0 || (segment.flags & PF_R) == 0
+                    || (segment.flags & PF_W) != 0){
+                    continue;
+                }
+
+                uintptr_t start = (segment.address + hugePageSize - 1) & ~(hugePageSize - 1);
+                uintptr_t end = (segment.address + segment.memorySize) & ~(hugePageSize - 1);
+                if(start >= end){
+                    continue;
+                }
+                size_t size = end - start;
+
+                bool moved = false;
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+                //Not every kernel can mremap hugetlbfs pages, so fall back to THP on any failure
+                if(mode == HugePageMode::Explicit){
+                    void* pages = mapExplicitHugePages(size);
+                    moved = pages != nullptr && moveCode(start, size, pages);
+                }
+#endif
+                if(!moved){
+                    void* pages = mapTransparentHugePages(size);
+                    moved = pages != nullptr && moveCode(start, size, pages);
+                }
+                if(moved){
+                    remapped += size;
+                }
+            }
+            return remapped;
+        }
+    };
+#endif
+};
+
+#endif
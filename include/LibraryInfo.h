@@ -0,0 +1,410 @@
+#ifndef __LIBRARY_INFO_H__
+#define __LIBRARY_INFO_H__
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <cstring>
+#include <set>
+#include <dlfcn.h>
+#include <elf.h>
+#include <link.h>
+#endif
+
+#include "Exceptions.h"
+
+namespace Polysoft {
+    /**
+     * A program header of a loaded library
+     */
+    struct SegmentInfo {
+        /**
+         * The segment type (PT_LOAD, PT_DYNAMIC, PT_TLS, ...)
+         */
+        uint32_t type = 0;
+
+        /**
+         * The segment permissions (a combination of PF_R, PF_W and PF_X)
+         */
+        uint32_t flags = 0;
+
+        /**
+         * Where the segment starts in memory
+         */
+        uintptr_t address = 0;
+
+        /**
+         * How many bytes of the segment come from the file
+         */
+        size_t fileSize = 0;
+
+        /**
+         * How many bytes the segment occupies in memory
+         */
+        size_t memorySize = 0;
+
+        /**
+         * The alignment the segment was linked with
+         */
+        size_t alignment = 0;
+    };
+
+    /**
+     * The thread local storage used by a loaded library
+     */
+    struct TlsInfo {
+        /**
+         * The TLS module id assigned by the loader, 0 if the library has no TLS
+         */
+        size_t moduleId = 0;
+
+        /**
+         * The size of the library's TLS block for each thread
+         */
+        size_t size = 0;
+
+        /**
+         * The part of size that is initialised from the file (.tdata), the rest is .tbss
+         */
+        size_t initSize = 0;
+
+        /**
+         * The alignment of the TLS block
+         */
+        size_t alignment = 0;
+    };
+
+    /**
+     * A library that was loaded because something needed it
+     */
+    struct DependencyInfo {
+        /**
+         * The name as it appears in DT_NEEDED
+         */
+        std::string name;
+
+        /**
+         * The path the loader resolved name to, empty if it could not be found
+         */
+        std::string path;
+
+        /**
+         * How far the dependency is from the inspected library, 1 for direct dependencies
+         */
+        size_t depth = 0;
+    };
+
+    /**
+     * What the loader did to bring a library in, as reported by DLManager::getInfo()
+     */
+    struct LibraryInfo {
+        /**
+         * The path the loader opened the library from
+         */
+        std::string path;
+
+        /**
+         * The address every segment address is relative to in the file
+         */
+        uintptr_t baseAddress = 0;
+
+        /**
+         * All program headers of the library
+         */
+        std::vector<SegmentInfo> segments;
+
+        /**
+         * The total memory size of all PT_LOAD segments
+         */
+        size_t loadedSize = 0;
+
+        /**
+         * Thread local storage usage
+         */
+        TlsInfo tls;
+
+        /**
+         * Every library pulled in by this one, directly or not, in breadth first order
+         */
+        std::vector<DependencyInfo> dependencies;
+
+        /**
+         * How many dynamic relocations of each type (R_X86_64_*, R_AARCH64_*, ...) the library has.
+         * Relative relocations packed in DT_RELR are counted under the architecture's RELATIVE type.
+         */
+        std::map<uint32_t, size_t> relocationCounts;
+
+        /**
+         * How long the library took to open, including running its constructors
+         */
+        std::chrono::nanoseconds openDuration = std::chrono::nanoseconds(0);
+
+        /**
+         * @return The total number of dynamic relocations
+         */
+        size_t getRelocationCount() const {
+            size_t total = 0;
+            for(const auto& count : relocationCounts){
+                total += count.second;
+            }
+            return total;
+        }
+    };
+
+#ifdef __linux__
+    namespace detail {
+#if UINTPTR_MAX > 0xffffffffu
+        inline uint32_t relocationType(ElfW(Xword) info) { return ELF64_R_TYPE(info); }
+#else
+        inline uint32_t relocationType(ElfW(Word) info) { return ELF32_R_TYPE(info); }
+#endif
+
+        /**
+         * The relocation type DT_RELR entries stand for, 0 if unknown for this architecture
+         */
+        inline uint32_t relativeRelocationType() {
+#if defined(__x86_64__)
+            return R_X86_64_RELATIVE;
+#elif defined(__i386__)
+            return R_386_RELATIVE;
+#elif defined(__aarch64__)
+            return R_AARCH64_RELATIVE;
+#elif defined(__arm__)
+            return R_ARM_RELATIVE;
+#else
+            return 0;
+#endif
+        }
+
+        /**
+         * glibc relocates the pointers in the dynamic section on most, but not all, architectures
+         * and musl never does, so anything below the load base still needs it added.
+         */
+        inline uintptr_t dynamicPointer(const link_map* map, ElfW(Addr) ptr) {
+            return ptr < map->l_addr ? map->l_addr + ptr : ptr;
+        }
+
+        inline const char* dynamicStrings(const link_map* map) {
+            for(const ElfW(Dyn)* dyn = map->l_ld; dyn->d_tag != DT_NULL; ++dyn){
+                if(dyn->d_tag == DT_STRTAB){
+                    return reinterpret_cast<const char*>(dynamicPointer(map, dyn->d_un.d_ptr));
+                }
+            }
+            return nullptr;
+        }
+
+        inline std::vector<std::string> neededLibraries(const link_map* map) {
+            std::vector<std::string> needed;
+            const char* strings = dynamicStrings(map);
+            if(strings == nullptr){
+                return needed;
+            }
+
+            for(const ElfW(Dyn)* dyn = map->l_ld; dyn->d_tag != DT_NULL; ++dyn){
+                if(dyn->d_tag == DT_NEEDED){
+                    needed.push_back(strings + dyn->d_un.d_val);
+                }
+            }
+            return needed;
+        }
+
+        template<typename Rel>
+        void countRelocations(uintptr_t start, size_t size, size_t entrySize, std::map<uint32_t, size_t>& counts) {
+            if(start == 0 || entrySize == 0){
+                return;
+            }
+            for(size_t offset = 0; offset + entrySize <= size; offset += entrySize){
+                const Rel* rel = reinterpret_cast<const Rel*>(start + offset);
+                ++counts[relocationType(rel->r_info)];
+            }
+        }
+
+        inline void countRelocations(const link_map* map, std::map<uint32_t, size_t>& counts) {
+            uintptr_t rela = 0, rel = 0, jmprel = 0, relr = 0;
+            size_t relaSize = 0, relaEnt = sizeof(ElfW(Rela));
+            size_t relSize = 0, relEnt = sizeof(ElfW(Rel));
+            size_t jmprelSize = 0, relrSize = 0;
+            ElfW(Sxword) pltRel = DT_RELA;
+
+            for(const ElfW(Dyn)* dyn = map->l_ld; dyn->d_tag != DT_NULL; ++dyn){
+                switch(dyn->d_tag){
+                case DT_RELA: rela = dynamicPointer(map, dyn->d_un.d_ptr); break;
+                case DT_RELASZ: relaSize = dyn->d_un.d_val; break;
+                case DT_RELAENT: relaEnt = dyn->d_un.d_val; break;
+                case DT_REL: rel = dynamicPointer(map, dyn->d_un.d_ptr); break;
+                case DT_RELSZ: relSize = dyn->d_un.d_val; break;
+                case DT_RELENT: relEnt = dyn->d_un.d_val; break;
+                case DT_JMPREL: jmprel = dynamicPointer(map, dyn->d_un.d_ptr); break;
+                case DT_PLTRELSZ: jmprelSize = dyn->d_un.d_val; break;
+                case DT_PLTREL: pltRel = dyn->d_un.d_val; break;
+#ifdef DT_RELR
+                case DT_RELR: relr = dynamicPointer(map, dyn->d_un.d_ptr); break;
+                case DT_RELRSZ: relrSize = dyn->d_un.d_val; break;
+#endif
+                default: break;
+                }
+            }
+
+            //Some linkers make DT_RELA/DT_REL cover the PLT relocations as well
+            if(jmprel != 0 && pltRel == DT_RELA && jmprel >= rela && jmprel + jmprelSize <= rela + relaSize){
+                relaSize -= jmprelSize;
+            }
+            if(jmprel != 0 && pltRel == DT_REL && jmprel >= rel && jmprel + jmprelSize <= rel + relSize){
+                relSize -= jmprelSize;
+            }
+
+            countRelocations<ElfW(Rela)>(rela, relaSize, relaEnt, counts);
+            countRelocations<ElfW(Rel)>(rel, relSize, relEnt, counts);
+            if(pltRel == DT_RELA){
+                countRelocations<ElfW(Rela)>(jmprel, jmprelSize, sizeof(ElfW(Rela)), counts);
+            } else {
+                countRelocations<ElfW(Rel)>(jmprel, jmprelSize, sizeof(ElfW(Rel)), counts);
+            }
+
+            //DT_RELR holds addresses followed by bitmaps of further relative relocations
+            uint32_t relative = relativeRelocationType();
+            if(relr != 0 && relative != 0){
+                const ElfW(Addr)* entries = reinterpret_cast<const ElfW(Addr)*>(relr);
+                size_t packed = 0;
+                for(size_t i = 0; i < relrSize / sizeof(ElfW(Addr)); ++i){
+                    ElfW(Addr) entry = entries[i];
+                    if((entry & 1) == 0){
+                        ++packed;
+                        continue;
+                    }
+                    for(entry >>= 1; entry != 0; entry >>= 1){
+                        packed += entry & 1;
+                    }
+                }
+                if(packed != 0){
+                    counts[relative] += packed;
+                }
+            }
+        }
+
+        struct PhdrSearch {
+            const link_map* map;
+            LibraryInfo* info;
+            bool found;
+        };
+
+        inline int collectSegments(dl_phdr_info* phdr, size_t, void* data) {
+            PhdrSearch* search = static_cast<PhdrSearch*>(data);
+            if(phdr->dlpi_addr != search->map->l_addr || phdr->dlpi_name == nullptr
+                || std::strcmp(phdr->dlpi_name, search->map->l_name) != 0){
+                return 0;
+            }
+
+            LibraryInfo& info = *search->info;
+            info.tls.moduleId = phdr->dlpi_tls_modid;
+            for(ElfW(Half) i = 0; i < phdr->dlpi_phnum; ++i){
+                const ElfW(Phdr)& header = phdr->dlpi_phdr[i];
+
+                SegmentInfo segment;
+                segment.type = header.p_type;
+                segment.flags = header.p_flags;
+                segment.address = phdr->dlpi_addr + header.p_vaddr;
+                segment.fileSize = header.p_filesz;
+                segment.memorySize = header.p_memsz;
+                segment.alignment = header.p_align;
+                info.segments.push_back(segment);
+
+                if(header.p_type == PT_LOAD){
+                    info.loadedSize += header.p_memsz;
+                } else if(header.p_type == PT_TLS){
+                    info.tls.size = header.p_memsz;
+                    info.tls.initSize = header.p_filesz;
+                    info.tls.alignment = header.p_align;
+                }
+            }
+            search->found = true;
+            return 1;
+        }
+
+        inline const link_map* getLinkMap(void* handle) {
+            link_map* map = nullptr;
+            //Clear previous errors
+            dlerror();
+            if(dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0 || map == nullptr){
+                const char* err = dlerror();
+                throw LibraryInfoException(err != nullptr ? err : "dlinfo(RTLD_DI_LINKMAP) failed");
+            }
+            return map;
+        }
+
+        /**
+         * Walks DT_NEEDED breadth first. Each name is looked up with RTLD_NOLOAD, which only
+         * succeeds for libraries that are already loaded and so never loads anything new.
+         */
+        inline void collectDependencies(const link_map* root, std::vector<DependencyInfo>& out) {
+            std::set<std::string> seen;
+            seen.insert(root->l_name);
+
+            std::vector<std::pair<const link_map*, size_t>> pending;
+            pending.push_back(std::make_pair(root, size_t(0)));
+
+            for(size_t next = 0; next < pending.size(); ++next){
+                size_t depth = pending[next].second + 1;
+                std::vector<std::string> needed = neededLibraries(pending[next].first);
+
+                for(const std::string& name : needed){
+                    void* handle = dlopen(name.c_str(), RTLD_LAZY | RTLD_NOLOAD);
+                    link_map* map = nullptr;
+                    if(handle != nullptr && dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0){
+                        map = nullptr;
+                    }
+
+                    std::string path = map != nullptr ? map->l_name : "";
+                    if(seen.insert(path.empty() ? name : path).second){
+                        DependencyInfo dependency;
+                        dependency.name = name;
+                        dependency.path = path;
+                        dependency.depth = depth;
+                        out.push_back(dependency);
+
+                        if(map != nullptr){
+                            pending.push_back(std::make_pair(const_cast<const link_map*>(map), depth));
+                        }
+                    }
+
+                    //The library is still held by whoever needed it, so the link_map stays valid
+                    if(handle != nullptr){
+                        dlclose(handle);
+                    }
+                }
+            }
+        }
+
+        /**
+         * Fills in everything about an open library that the loader knows
+         *
+         * @param [in] handle A handle returned by dlopen
+         * @param [out] info Where to store the report
+         * @throw LibraryInfoException
+         *  When the loader does not know about the handle, a LibraryInfoException is thrown
+         */
+        inline void inspectLibrary(void* handle, LibraryInfo& info) {
+            const link_map* map = getLinkMap(handle);
+
+            info.path = map->l_name;
+            info.baseAddress = map->l_addr;
+
+            PhdrSearch search = { map, &info, false };
+            dl_iterate_phdr(collectSegments, &search);
+            if(!search.found){
+                throw LibraryInfoException("Could not find the program headers of " + info.path);
+            }
+
+            countRelocations(map, info.relocationCounts);
+            collectDependencies(map, info.dependencies);
+        }
+    };
+#endif
+};
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef __LIBRARY_MEMORY_H__
+#define __LIBRARY_MEMORY_H__
+
+#include <cstddef>
+#include <string>
+
+#ifdef __linux__
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <vector>
+#include <malloc.h>
+#include <unistd.h>
+#include "LibraryInfo.h"
+#endif
+
+#include "Exceptions.h"
+
+namespace Polysoft {
+    /**
+     * Extra work DLManager::open() can do while opening a library
+     */
+    enum class OpenOption {
+        /**
+         * Just open the library
+         */
+        Default,
+
+        /**
+         * Also record how much the heap grows during open() (LoadStats::openHeapBytes).
+         * This queries the allocator before and after, which on glibc locks every malloc arena
+         * and walks its free chunks, stalling all allocating threads for that time on a large heap.
+         */
+        SampleHeap
+    };
+
+    /**
+     * How much memory a loaded library accounts for, as reported by DLManager::getMemoryUsage().
+     * Only the library's own mappings are counted, not those of its dependencies.
+     * All sizes are in bytes.
+     */
+    struct MemoryUsage {
+        /**
+         * The path the loader opened the library from, empty for totals
+         */
+        std::string path;
+
+        /**
+         * How much address space the library's mappings take
+         */
+        size_t mappedSize = 0;
+
+        /**
+         * How much of the mapped size is resident
+         */
+        size_t rss = 0;
+
+        /**
+         * The resident size with pages shared between processes split evenly between them
+         */
+        size_t pss = 0;
+
+        /**
+         * Resident pages shared with other processes that were not written to
+         */
+        size_t sharedClean = 0;
+
+        /**
+         * Resident pages shared with other processes that were written to
+         */
+        size_t sharedDirty = 0;
+
+        /**
+         * Resident pages only this process uses that were not written to
+         */
+        size_t privateClean = 0;
+
+        /**
+         * Resident pages only this process uses that were written to, such as relocated data and .bss
+         */
+        size_t privateDirty = 0;
+
+        /**
+         * How much the heap grew during open(), 0 unless it was opened with
+         * OpenOption::SampleHeap, see LoadStats::openHeapBytes
+         */
+        long long openHeapBytes = 0;
+
+        MemoryUsage& operator+=(const MemoryUsage& in) {
+            mappedSize += in.mappedSize;
+            rss += in.rss;
+            pss += in.pss;
+            sharedClean += in.sharedClean;
+            sharedDirty += in.sharedDirty;
+            privateClean += in.privateClean;
+            privateDirty += in.privateDirty;
+            openHeapBytes += in.openHeapBytes;
+            return *this;
+        }
+    };
+
+#ifdef __linux__
+    namespace detail {
+        /**
+         * @return How many bytes the allocator currently has handed out, 0 if it cannot be asked
+         */
+        inline long long getHeapInUse() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+            struct mallinfo2 info = mallinfo2();
+            return static_cast<long long>(info.uordblks + info.hblkhd);
+#else
+            return 0;
+#endif
+        }
+
+        /**
+         * The address range a library's PT_LOAD segments were mapped into
+         */
+        struct MappedRange {
+            std::string path;
+            uintptr_t start;
+            uintptr_t end;
+        };
+
+        inline MappedRange getMappedRange(void* handle) {
+            const link_map* map = getLinkMap(handle);
+
+            LibraryInfo info;
+            PhdrSearch search = { map, &info, false };
+            dl_iterate_phdr(collectSegments, &search);
+            if(!search.found){
+                throw LibraryInfoException(std::string("Could not find the program headers of ") + map->l_name);
+            }
+
+            uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+            MappedRange range = { map->l_name, UINTPTR_MAX, 0 };
+            for(const SegmentInfo& segment : info.segments){
+                if(segment.type != PT_LOAD){
+                    continue;
+                }
+                uintptr_t start = segment.address & ~(page - 1);
+                uintptr_t end = (segment.address + segment.memorySize + page - 1) & ~(page - 1);
+                range.start = start < range.start ? start : range.start;
+                range.end = end > range.end ? end : range.end;
+            }
+            if(range.start >= range.end){
+                throw LibraryInfoException("No loadable segments found in " + range.path);
+            }
+            return range;
+        }
+
+        /**
+         * Adds up /proc/self/smaps for every mapping inside each range, reading the file only once.
+         * This also picks up the anonymous mapping the loader makes for .bss past the file's end.
+         *
+         * @param [in] ranges The ranges to account for
+         * @param [out] usage One entry per range, in the same order
+         */
+        inline void readSmaps(const std::vector<MappedRange>& ranges, std::vector<MemoryUsage>& usage) {
+            std::ifstream smaps("/proc/self/smaps");
+            if(!smaps){
+                throw LibraryInfoException("Could not open /proc/self/smaps");
+            }
+
+            usage.assign(ranges.size(), MemoryUsage());
+            for(size_t i = 0; i < ranges.size(); ++i){
+                usage[i].path = ranges[i].path;
+            }
+
+            static const std::map<std::string, size_t MemoryUsage::*> fields = {
+                { "Size", &MemoryUsage::mappedSize },
+                { "Rss", &MemoryUsage::rss },
+                { "Pss", &MemoryUsage::pss },
+                { "Shared_Clean", &MemoryUsage::sharedClean },
+                { "Shared_Dirty", &MemoryUsage::sharedDirty },
+                { "Private_Clean", &MemoryUsage::privateClean },
+                { "Private_Dirty", &MemoryUsage::privateDirty },
+            };
+
+            MemoryUsage* current = nullptr;
+            std::string line;
+            while(std::getline(smaps, line)){
+                unsigned long start, end;
+                if(std::sscanf(line.c_str(), "%lx-%lx ", &start, &end) == 2){
+                    current = nullptr;
+                    for(size_t i = 0; i < ranges.size(); ++i){
+                        if(start >= ranges[i].start && end <= ranges[i].end){
+                            current = &usage[i];
+                            break;
+                        }
+                    }
+                    continue;
+                }
+                if(current == nullptr){
+                    continue;
+                }
+
+                char name[64];
+                unsigned long kilobytes;
+                if(std::sscanf(line.c_str(), "%63[^:]: %lu kB", name, &kilobytes) != 2){
+                    continue;
+                }
+                auto field = fields.find(name);
+                if(field != fields.end()){
+                    current->*(field->second) += static_cast<size_t>(kilobytes) * 1024;
+                }
+            }
+        }
+    };
+#endif
+};
+
+#endif
@@ -0,0 +1,346 @@
+#ifndef __LIBRARY_REF_H__
+#define __LIBRARY_REF_H__
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
+#include "Exceptions.h"
+
+#ifdef _WIN32
+typedef HMODULE SharedLib;
+#else
+typedef void* SharedLib;
+#endif
+
+namespace Polysoft {
+    /**
+     * What it cost to open a library, measured by DLManager::open()
+     */
+    struct LoadStats {
+        /**
+         * How long the platform loader took to open the library, including its constructors
+         */
+        std::chrono::nanoseconds openDuration = std::chrono::nanoseconds(0);
+
+        /**
+         * How much the heap grew during the whole open(). This is what the library's constructors
+         * allocated plus the loader's own bookkeeping (link_map, search scopes, ...), which is
+         * several kilobytes even for a library without constructors. Allocations made by other
+         * threads at the same time are counted too, so this can even be negative.
+         * Only measured when opened with OpenOption::SampleHeap, 0 otherwise or where the
+         * allocator cannot be queried.
+         */
+        long long openHeapBytes = 0;
+    };
+
+    namespace detail {
+#ifdef _WIN32
+        /**
+         * @return The system's description of GetLastError()
+         */
+        inline std::string getLastErrorMessage() {
+            DWORD dLastError = GetLastError();
+            LPSTR strErrorMessage = NULL;
+
+            DWORD length = FormatMessageA(
+                FORMAT_MESSAGE_FROM_SYSTEM | FORMAT_MESSAGE_IGNORE_INSERTS | FORMAT_MESSAGE_ARGUMENT_ARRAY | FORMAT_MESSAGE_ALLOCATE_BUFFER,
+                NULL,
+                dLastError,
+                0,
+                (LPSTR)&strErrorMessage,
+                0,
+                NULL);
+            if(length == 0 || strErrorMessage == NULL){
+                return "Error " + std::to_string(dLastError);
+            }
+
+            std::string message(strErrorMessage, length);
+            LocalFree(strErrorMessage);
+            return message;
+        }
+#endif
+
+        struct LibraryControl;
+
+        /**
+         * Every library currently held by a LibraryRef, so that they can be reported on together
+         */
+        struct LibraryRegistry {
+            std::mutex lock;
+            std::set<LibraryControl*> libraries;
+        };
+
+        /**
+         * The registry is never freed, so that LibraryRefs in globals that are destroyed after
+         * it would have been can still remove themselves from it
+         */
+        inline LibraryRegistry& getLibraryRegistry() {
+            static LibraryRegistry* registry = new LibraryRegistry;
+            return *registry;
+        }
+
+        /**
+         * The block shared by every LibraryRef that points at the same open()'d library.
+         * The count lives next to the handle, so copying a reference is a single atomic increment.
+         */
+        struct LibraryControl {
+            SharedLib handle;
+            std::atomic<unsigned long> refs;
+            LoadStats stats;
+
+            LibraryControl(SharedLib handle, const LoadStats& stats)
+                : handle(handle), refs(1), stats(stats)
+            {
+                LibraryRegistry& registry = getLibraryRegistry();
+                std::lock_guard<std::mutex> guard(registry.lock);
+                registry.libraries.insert(this);
+            }
+        };
+    };
+
+    /**
+     * A reference counted handle to an open dynamic library.
+     * The library is closed when the last LibraryRef pointing at it is reset or destroyed,
+     * so anything holding one (such as a Symbol) can safely outlive the DLManager it came from.
+     */
+    class LibraryRef {
+    private:
+        detail::LibraryControl* control = nullptr;
+
+        /**
+         * Drops this reference, closing the library if it was the last one.
+         *
+         * @param [out] error Set to the loader's error message if closing failed
+         * @return false if the library had to be closed and could not be
+         */
+        bool release(std::string& error) noexcept {
+            detail::LibraryControl* old = control;
+            control = nullptr;
+
+            if(old == nullptr || old->refs.fetch_sub(1, std::memory_order_acq_rel) != 1){
+                return true;
+            }
+            //Leave the registry first so getOpenLibraries() cannot pick up a closing library
+            {
+                detail::LibraryRegistry& registry = detail::getLibraryRegistry();
+                std::lock_guard<std::mutex> guard(registry.lock);
+                registry.libraries.erase(old);
+            }
+
+            bool closed;
+#ifdef _WIN32
+            closed = FreeLibrary(old->handle) != 0;
+            if(!closed){
+                error = detail::getLastErrorMessage();
+            }
+#else
+            //Clear previous errors
+            dlerror();
+            closed = dlclose(old->handle) == 0;
+            if(!closed){
+                const char* msg = dlerror();
+                error = msg != nullptr ? msg : "dlclose failed";
+            }
+#endif
+            delete old;
+            return closed;
+        }
+
+        void acquire() noexcept {
+            if(control != nullptr){
+                control->refs.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    public:
+        /**
+         * Default constructor, does not refer to any library
+         */
+        LibraryRef() = default;
+
+        /**
+         * Takes ownership of a handle returned by the platform loader.
+         * The handle will be closed once every copy of this reference is gone.
+         *
+         * @param [in] handle The handle to adopt, may be nullptr
+         * @param [in] stats What it cost to open the handle
+         */
+        explicit LibraryRef(SharedLib handle, const LoadStats& stats = LoadStats())
+            : control(handle != nullptr ? new detail::LibraryControl(handle, stats) : nullptr) {}
+
+        LibraryRef(const LibraryRef& in) noexcept : control(in.control) {
+            acquire();
+        }
+
+        LibraryRef(LibraryRef&& in) noexcept : control(in.control) {
+            in.control = nullptr;
+        }
+
+        LibraryRef& operator=(const LibraryRef& in) noexcept {
+            if(control != in.control){
+                std::string ignored;
+                release(ignored);
+                control = in.control;
+                acquire();
+            }
+            return *this;
+        }
+
+        LibraryRef& operator=(LibraryRef&& in) noexcept {
+            if(this != &in){
+                std::string ignored;
+                release(ignored);
+                control = in.control;
+                in.control = nullptr;
+            }
+            return *this;
+        }
+
+        /**
+         * Destructor, drops this reference and closes the library if it was the last one.
+         * Errors from closing cannot be reported here, use reset() if they matter.
+         */
+        ~LibraryRef() {
+            std::string ignored;
+            release(ignored);
+        }
+
+        /**
+         * Drops this reference, closing the library if it was the last one
+         *
+         * @throw CloseLibraryException
+         *  When the library had to be closed and could not be, a CloseLibraryException is thrown
+         */
+        void reset() {
+            std::string error;
+            if(!release(error)){
+                throw CloseLibraryException(error);
+            }
+        }
+
+        /**
+         * @return The raw handle of the library, or nullptr if nothing is referenced
+         */
+        SharedLib get() const noexcept {
+            return control != nullptr ? control->handle : nullptr;
+        }
+
+        /**
+         * @return How many references currently keep the library open, 0 if nothing is referenced
+         */
+        unsigned long useCount() const noexcept {
+            return control != nullptr ? control->refs.load(std::memory_order_relaxed) : 0;
+        }
+
+        /**
+         * @return What it cost to open the library, all zero if nothing is referenced
+         */
+        LoadStats getLoadStats() const noexcept {
+            return control != nullptr ? control->stats : LoadStats();
+        }
+
+        /**
+         * @return A reference to every library that is currently open through a LibraryRef,
+         *  including those held by DLManagers. A library open()'d more than once appears once
+         *  for each time it was opened.
+         */
+        static std::vector<LibraryRef> getOpenLibraries() {
+            std::vector<LibraryRef> result;
+            detail::LibraryRegistry& registry = detail::getLibraryRegistry();
+            std::lock_guard<std::mutex> guard(registry.lock);
+
+            for(detail::LibraryControl* library : registry.libraries){
+                //Only take a reference if the last one is not being dropped right now
+                unsigned long refs = library->refs.load(std::memory_order_relaxed);
+                while(refs != 0 && !library->refs.compare_exchange_weak(refs, refs + 1, std::memory_order_relaxed)){}
+
+                if(refs != 0){
+                    LibraryRef ref;
+                    ref.control = library;
+                    result.push_back(std::move(ref));
+                }
+            }
+            return result;
+        }
+
+        /**
+         * @return true if a library is referenced
+         */
+        explicit operator bool() const noexcept {
+            return control != nullptr;
+        }
+    };
+
+    template<typename T>
+    class Symbol;
+
+    /**
+     * A function retrieved from a dynamic library that keeps the library loaded for as long
+     * as the Symbol (or any copy of it) exists.
+     * Calling it is a direct call through the function pointer, copying it is a refcount increment.
+     *
+     * @tparam R The return type of the function
+     * @tparam Args The parameter types of the function
+     */
+    template<typename R, typename... Args>
+    class Symbol<R(Args...)> {
+    private:
+        LibraryRef library;
+        R (*function)(Args...) = nullptr;
+    public:
+        /**
+         * Default constructor, does not refer to any function
+         */
+        Symbol() = default;
+
+        /**
+         * @param [in] library The library that function lives in
+         * @param [in] function The function pointer resolved from library
+         */
+        Symbol(LibraryRef library, R (*function)(Args...))
+            : library(std::move(library)), function(function) {}
+
+        /**
+         * Calls the function
+         */
+        R operator()(Args... args) const {
+            return function(std::forward<Args>(args)...);
+        }
+
+        /**
+         * @return The raw function pointer, only valid while this Symbol is alive
+         */
+        R (*get() const noexcept)(Args...) {
+            return function;
+        }
+
+        /**
+         * @return The reference keeping the library loaded
+         */
+        const LibraryRef& getLibrary() const noexcept {
+            return library;
+        }
+
+        /**
+         * @return true if a function is referenced
+         */
+        explicit operator bool() const noexcept {
+            return function != nullptr;
+        }
+    };
+};
+
+#endif